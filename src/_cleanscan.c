@@ -0,0 +1,551 @@
+/*
+ * Optional native directory scanner for the 'clean' script.
+ *
+ * Lists a directory with getdents64, tells directories from files by
+ * d_type (stat'ing only entries of unknown type), and matches every
+ * entry against the compiled suffix and glob patterns without the GIL.
+ * Only the matches (and the subdirectories to descend into) are passed
+ * back to Python. 'clean' falls back to its pure Python scanner when
+ * this module is not built.
+ *
+ * Build it next to the script with:
+ *
+ *     cc -O2 -shared -fPIC $(python3-config --includes) \
+ *         -o _cleanscan$(python3-config --extension-suffix) _cleanscan.c
+ *
+ * Linux only.
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef DT_UNKNOWN
+#define DT_UNKNOWN 0
+#define DT_DIR 4
+#define DT_LNK 10
+#endif
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+/* kinds of matched entries, as listed by the Python scanner */
+enum { KIND_FILE = 0, KIND_DIR = 1, KIND_DIR_LINK = 2 };
+
+typedef struct {
+    char **items;
+    size_t *lens;
+    Py_ssize_t n;
+} strings_t;
+
+/* one set of patterns: matches if any suffix or glob matches */
+typedef struct {
+    strings_t suffixes;
+    strings_t name_globs;
+    strings_t path_globs;
+    int negate;
+} spec_t;
+
+typedef struct {
+    PyObject_HEAD
+    spec_t *specs;
+    Py_ssize_t n_specs;
+    strings_t special;
+    int need_path;
+} MatcherObject;
+
+/* a listed entry kept for the way back to Python */
+typedef struct {
+    size_t name_off;
+    size_t name_len;
+    int tag;
+    int kind;
+    int has_st;
+    struct stat st;
+} record_t;
+
+typedef struct {
+    record_t *recs;
+    size_t n, cap;
+    char *names;
+    size_t names_len, names_cap;
+} records_t;
+
+
+/* ---------------------------------------------------------------- */
+/* patterns */
+
+static void
+strings_free(strings_t *s)
+{
+    Py_ssize_t i;
+    for (i = 0; i < s->n; i++)
+        free(s->items[i]);
+    free(s->items);
+    free(s->lens);
+    s->items = NULL;
+    s->lens = NULL;
+    s->n = 0;
+}
+
+/* fills s with the filesystem encoding of a sequence of str */
+static int
+strings_from(strings_t *s, PyObject *seq)
+{
+    PyObject *fast, *bytes;
+    Py_ssize_t i, n;
+
+    fast = PySequence_Fast(seq, "patterns must be a sequence");
+    if (fast == NULL)
+        return -1;
+    n = PySequence_Fast_GET_SIZE(fast);
+    s->items = calloc(n ? n : 1, sizeof(char *));
+    s->lens = calloc(n ? n : 1, sizeof(size_t));
+    s->n = 0;
+    if (s->items == NULL || s->lens == NULL) {
+        Py_DECREF(fast);
+        PyErr_NoMemory();
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        if (!PyUnicode_FSConverter(PySequence_Fast_GET_ITEM(fast, i),
+                                   &bytes)) {
+            Py_DECREF(fast);
+            return -1;
+        }
+        s->lens[i] = PyBytes_GET_SIZE(bytes);
+        s->items[i] = malloc(s->lens[i] + 1);
+        if (s->items[i] == NULL) {
+            Py_DECREF(bytes);
+            Py_DECREF(fast);
+            PyErr_NoMemory();
+            return -1;
+        }
+        memcpy(s->items[i], PyBytes_AS_STRING(bytes), s->lens[i] + 1);
+        s->n++;
+        Py_DECREF(bytes);
+    }
+    Py_DECREF(fast);
+    return 0;
+}
+
+static int
+strings_contain(const strings_t *s, const char *name, size_t len)
+{
+    Py_ssize_t i;
+    for (i = 0; i < s->n; i++)
+        if (s->lens[i] == len && memcmp(s->items[i], name, len) == 0)
+            return 1;
+    return 0;
+}
+
+/* whether base + name (base ending with a separator) ends with suffix */
+static int
+ends_with(const char *base, size_t base_len, const char *name,
+          size_t name_len, const char *suffix, size_t len)
+{
+    if (len <= name_len)
+        return memcmp(name + name_len - len, suffix, len) == 0;
+    len -= name_len;
+    if (len > base_len || memcmp(suffix + len, name, name_len) != 0)
+        return 0;
+    return memcmp(base + base_len - len, suffix, len) == 0;
+}
+
+/* returns the index of the first spec matching the entry, or -1 */
+static int
+match(MatcherObject *m, const char *base, size_t base_len,
+      const char *name, size_t name_len, const char *path)
+{
+    Py_ssize_t i, j;
+
+    for (i = 0; i < m->n_specs; i++) {
+        spec_t *spec = &m->specs[i];
+        int found = 0;
+        strings_t *suffixes = &spec->suffixes;
+        for (j = 0; !found && j < suffixes->n; j++)
+            found = ends_with(base, base_len, name, name_len,
+                              suffixes->items[j], suffixes->lens[j]);
+        /* as fnmatch.fnmatchcase: '*' matches '/', no escapes */
+        for (j = 0; !found && j < spec->name_globs.n; j++)
+            found = fnmatch(spec->name_globs.items[j], name,
+                            FNM_NOESCAPE) == 0;
+        for (j = 0; !found && j < spec->path_globs.n; j++)
+            found = fnmatch(spec->path_globs.items[j], path,
+                            FNM_NOESCAPE) == 0;
+        if (found != spec->negate)
+            return (int)i;
+    }
+    return -1;
+}
+
+
+/* ---------------------------------------------------------------- */
+/* Matcher */
+
+static void
+Matcher_dealloc(MatcherObject *self)
+{
+    Py_ssize_t i;
+    for (i = 0; i < self->n_specs; i++) {
+        strings_free(&self->specs[i].suffixes);
+        strings_free(&self->specs[i].name_globs);
+        strings_free(&self->specs[i].path_globs);
+    }
+    free(self->specs);
+    strings_free(&self->special);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *
+Matcher_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"specs", "special", NULL};
+    PyObject *specs, *special = NULL, *fast;
+    MatcherObject *self;
+    Py_ssize_t i, n;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|O", kwlist,
+                                     &specs, &special))
+        return NULL;
+    self = (MatcherObject *)type->tp_alloc(type, 0);
+    if (self == NULL)
+        return NULL;
+    fast = PySequence_Fast(specs, "specs must be a sequence");
+    if (fast == NULL)
+        goto error;
+    n = PySequence_Fast_GET_SIZE(fast);
+    self->specs = calloc(n ? n : 1, sizeof(spec_t));
+    if (self->specs == NULL) {
+        Py_DECREF(fast);
+        PyErr_NoMemory();
+        goto error;
+    }
+    for (i = 0; i < n; i++) {
+        PyObject *suffixes, *name_globs, *path_globs;
+        spec_t *spec = &self->specs[i];
+        self->n_specs++;
+        if (!PyArg_ParseTuple(PySequence_Fast_GET_ITEM(fast, i), "OOOp",
+                              &suffixes, &name_globs, &path_globs,
+                              &spec->negate)
+            || strings_from(&spec->suffixes, suffixes) < 0
+            || strings_from(&spec->name_globs, name_globs) < 0
+            || strings_from(&spec->path_globs, path_globs) < 0) {
+            Py_DECREF(fast);
+            goto error;
+        }
+        if (spec->path_globs.n)
+            self->need_path = 1;
+    }
+    Py_DECREF(fast);
+    if (special != NULL && special != Py_None
+        && strings_from(&self->special, special) < 0)
+        goto error;
+    return (PyObject *)self;
+
+error:
+    Py_DECREF(self);
+    return NULL;
+}
+
+static PyTypeObject MatcherType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "_cleanscan.Matcher",
+    .tp_doc = PyDoc_STR(
+        "Matcher(specs, special=())\n\n"
+        "specs: sequence of (suffixes, name_globs, path_globs, negate);\n"
+        "an entry gets the index of the first spec matching it.\n"
+        "special: names which make scan() return None."),
+    .tp_basicsize = sizeof(MatcherObject),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = Matcher_new,
+    .tp_dealloc = (destructor)Matcher_dealloc,
+};
+
+
+/* ---------------------------------------------------------------- */
+/* scan */
+
+static int
+records_add(records_t *r, const char *name, size_t len, int tag, int kind,
+            const struct stat *st)
+{
+    record_t *rec;
+
+    if (r->n == r->cap) {
+        size_t cap = r->cap ? 2 * r->cap : 64;
+        record_t *recs = realloc(r->recs, cap * sizeof(record_t));
+        if (recs == NULL)
+            return -1;
+        r->recs = recs;
+        r->cap = cap;
+    }
+    if (r->names_len + len > r->names_cap) {
+        size_t cap = r->names_cap ? 2 * r->names_cap : 4096;
+        char *names;
+        while (cap < r->names_len + len)
+            cap *= 2;
+        names = realloc(r->names, cap);
+        if (names == NULL)
+            return -1;
+        r->names = names;
+        r->names_cap = cap;
+    }
+    rec = &r->recs[r->n++];
+    rec->name_off = r->names_len;
+    rec->name_len = len;
+    rec->tag = tag;
+    rec->kind = kind;
+    rec->has_st = st != NULL;
+    if (st != NULL)
+        rec->st = *st;
+    memcpy(r->names + r->names_len, name, len);
+    r->names_len += len;
+    return 0;
+}
+
+/* lists and matches dir into subdirs (tag -1) and matches; returns the
+ * number of entries, -1 with errno set on failure, or -2 if a special
+ * name was found */
+static long
+list_dir(MatcherObject *m, const char *dir, int want_stat, records_t *subdirs,
+         records_t *matches)
+{
+    /* uint64_t, for the d_ino and d_off of the records cast from it */
+    uint64_t buf[(1 << 15) / sizeof(uint64_t)];
+    char *path = NULL;
+    size_t base_len = strlen(dir), path_cap = 0;
+    long entries = 0;
+    int fd, sep;
+
+    fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return 0; /* unreadable directories are skipped, as by listdir */
+    sep = base_len == 0 || dir[base_len - 1] != '/';
+    path_cap = base_len + sep + 256;
+    path = malloc(path_cap);
+    if (path == NULL)
+        goto nomem;
+    memcpy(path, dir, base_len);
+    if (sep)
+        path[base_len++] = '/';
+
+    for (;;) {
+        long n = syscall(SYS_getdents64, fd, buf, sizeof(buf));
+        long off;
+        if (n <= 0)
+            break;
+        for (off = 0; off < n;) {
+            struct linux_dirent64 *d =
+                (struct linux_dirent64 *)((char *)buf + off);
+            const char *name = d->d_name;
+            size_t len = strlen(name);
+            struct stat st;
+            int type = d->d_type, has_st = 0, tag, kind;
+            off += d->d_reclen;
+
+            if (name[0] == '.' && (len == 1 || (len == 2 && name[1] == '.')))
+                continue;
+            if (strings_contain(&m->special, name, len)) {
+                entries = -2;
+                goto done;
+            }
+            entries++;
+            if (type == DT_UNKNOWN) {
+                if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+                    continue;
+                has_st = 1;
+                type = S_ISDIR(st.st_mode) ? DT_DIR
+                     : S_ISLNK(st.st_mode) ? DT_LNK : DT_UNKNOWN;
+            }
+            if (m->need_path) {
+                if (base_len + len + 1 > path_cap) {
+                    char *p;
+                    path_cap = base_len + len + 256;
+                    p = realloc(path, path_cap);
+                    if (p == NULL)
+                        goto nomem;
+                    path = p;
+                }
+                memcpy(path + base_len, name, len + 1);
+            }
+            tag = match(m, path, base_len, name, len, path);
+            if (tag < 0) {
+                if (type == DT_DIR && records_add(subdirs, name, len, -1,
+                                                  KIND_DIR, NULL) < 0)
+                    goto nomem;
+                continue;
+            }
+            kind = KIND_FILE;
+            if (type == DT_DIR) {
+                kind = KIND_DIR;
+            } else if (type == DT_LNK) {
+                struct stat target;
+                if (fstatat(fd, name, &target, 0) == 0
+                    && S_ISDIR(target.st_mode))
+                    kind = KIND_DIR_LINK;
+            }
+            if (want_stat && !has_st)
+                has_st = fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0;
+            if (records_add(matches, name, len, tag, kind,
+                            want_stat && has_st ? &st : NULL) < 0)
+                goto nomem;
+        }
+    }
+done:
+    free(path);
+    close(fd);
+    return entries;
+
+nomem:
+    free(path);
+    close(fd);
+    errno = ENOMEM;
+    return -1;
+}
+
+static PyObject *
+name_of(const records_t *r, const record_t *rec)
+{
+    return PyUnicode_DecodeFSDefaultAndSize(r->names + rec->name_off,
+                                            rec->name_len);
+}
+
+static PyObject *
+stat_tuple(const struct stat *st)
+{
+    long long mtime_ns = (long long)st->st_mtim.tv_sec * 1000000000LL
+                         + st->st_mtim.tv_nsec;
+    long long atime_ns = (long long)st->st_atim.tv_sec * 1000000000LL
+                         + st->st_atim.tv_nsec;
+    return Py_BuildValue("(KKLLIKKLI)",
+                         (unsigned long long)st->st_dev,
+                         (unsigned long long)st->st_ino, mtime_ns,
+                         (long long)st->st_size, (unsigned int)st->st_mode,
+                         (unsigned long long)st->st_blocks,
+                         (unsigned long long)st->st_nlink, atime_ns,
+                         (unsigned int)st->st_uid);
+}
+
+static PyObject *
+scan(PyObject *Py_UNUSED(module), PyObject *args)
+{
+    PyObject *dir_bytes, *subdirs = NULL, *matches = NULL, *result = NULL;
+    MatcherObject *m;
+    records_t sub = {0}, mat = {0};
+    int want_stat;
+    long entries;
+    size_t i;
+
+    if (!PyArg_ParseTuple(args, "O&O!p", PyUnicode_FSConverter, &dir_bytes,
+                          &MatcherType, &m, &want_stat))
+        return NULL;
+    Py_BEGIN_ALLOW_THREADS
+    entries = list_dir(m, PyBytes_AS_STRING(dir_bytes), want_stat,
+                       &sub, &mat);
+    Py_END_ALLOW_THREADS
+    Py_DECREF(dir_bytes);
+
+    if (entries == -1) {
+        PyErr_SetFromErrno(PyExc_OSError);
+        goto done;
+    }
+    if (entries == -2) {
+        result = Py_None;
+        Py_INCREF(result);
+        goto done;
+    }
+    subdirs = PyList_New(sub.n);
+    matches = PyList_New(mat.n);
+    if (subdirs == NULL || matches == NULL)
+        goto done;
+    for (i = 0; i < sub.n; i++) {
+        PyObject *name = name_of(&sub, &sub.recs[i]);
+        if (name == NULL)
+            goto done;
+        PyList_SET_ITEM(subdirs, i, name);
+    }
+    for (i = 0; i < mat.n; i++) {
+        record_t *rec = &mat.recs[i];
+        PyObject *st, *item;
+        if (rec->has_st) {
+            st = stat_tuple(&rec->st);
+            if (st == NULL)
+                goto done;
+        } else {
+            st = Py_None;
+            Py_INCREF(st);
+        }
+        item = Py_BuildValue("(NiiN)", name_of(&mat, rec), rec->tag,
+                             rec->kind, st);
+        if (item == NULL)
+            goto done;
+        PyList_SET_ITEM(matches, i, item);
+    }
+    result = Py_BuildValue("(OOl)", subdirs, matches, entries);
+
+done:
+    Py_XDECREF(subdirs);
+    Py_XDECREF(matches);
+    free(sub.recs);
+    free(sub.names);
+    free(mat.recs);
+    free(mat.names);
+    return result;
+}
+
+static PyMethodDef methods[] = {
+    {"scan", scan, METH_VARARGS,
+     PyDoc_STR(
+        "scan(path, matcher, want_stat) -> (subdirs, matches, entries)\n\n"
+        "Lists path and matches its entries with matcher. subdirs are the\n"
+        "names of the unmatched directories (not symlinks), matches the\n"
+        "(name, spec index, kind, stat) of the matched entries, kind being\n"
+        "0 for files, 1 for directories and 2 for symlinks to directories,\n"
+        "and stat (st_dev, st_ino, st_mtime_ns, st_size, st_mode,\n"
+        "st_blocks, st_nlink, st_atime_ns, st_uid) if want_stat. Returns\n"
+        "None if path holds an entry named as one of the matcher's\n"
+        "special names.")},
+    {NULL, NULL, 0, NULL}
+};
+
+static struct PyModuleDef module = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "_cleanscan",
+    .m_doc = PyDoc_STR("native directory scanner for clean"),
+    .m_size = -1,
+    .m_methods = methods,
+};
+
+PyMODINIT_FUNC
+PyInit__cleanscan(void)
+{
+    PyObject *m;
+
+    if (PyType_Ready(&MatcherType) < 0)
+        return NULL;
+    m = PyModule_Create(&module);
+    if (m == NULL)
+        return NULL;
+    Py_INCREF(&MatcherType);
+    if (PyModule_AddObject(m, "Matcher", (PyObject *)&MatcherType) < 0) {
+        Py_DECREF(&MatcherType);
+        Py_DECREF(m);
+        return NULL;
+    }
+    return m;
+}
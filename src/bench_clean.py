@@ -0,0 +1,390 @@
+#!/usr/bin/env python3
+"""
+Benchmarks for the 'clean' script.
+
+    bench_clean.py matchers [--counts 1,10,100,500] [--entries 20000]
+    bench_clean.py run [--scale 1.0] [--jobs 8] [-o results.json]
+    bench_clean.py compare before.json after.json
+
+The matchers benchmark times the per-entry cost of the endswith and glob
+matchers as the number of patterns grows, comparing the compiled
+SuffixMatcher/GlobMatcher against the original per-pattern lambdas.
+
+The run benchmark generates reproducible synthetic trees (wide, deep,
+many tiny files, dense with __pycache__) and times Cleaner.walk, the
+matchers, and the delete and convert actions in dry-run (scan only) and
+real modes. Results are written as JSON which compare diffs between two
+runs, e.g. before and after a change to the scan loop.
+
+These run the pure Python scanner; where the _cleanscan extension is
+built, the walk and dry-run benchmarks are repeated with it under a
+'/native' suffix. Before timing a tree, the run benchmark checks that
+--top reports the same sizes with and without --prune.
+"""
+
+import argparse
+import contextlib
+import importlib.machinery
+import importlib.util
+import io
+import json
+import os
+import platform
+import random
+import shutil
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+from fnmatch import fnmatch
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+
+def load_clean():
+    """imports the (extension-less) clean script as a module"""
+    path = os.path.join(HERE, 'clean')
+    loader = importlib.machinery.SourceFileLoader('clean', path)
+    spec = importlib.util.spec_from_loader('clean', loader)
+    module = importlib.util.module_from_spec(spec)
+    loader.exec_module(module)
+    return module
+
+
+def sample_paths(n, seed=0):
+    """returns n (path, name) pairs resembling a source tree"""
+    rng = random.Random(seed)
+    exts = ['.py', '.pyc', '.c', '.h', '.o', '.txt', '.json', '.DS_Store']
+    paths = []
+    for i in range(n):
+        parts = ['d%d' % rng.randrange(50) for _ in range(rng.randrange(1, 8))]
+        name = 'f%d%s' % (i, rng.choice(exts))
+        paths.append((os.path.join('.', *parts, name), name))
+    return paths
+
+
+def bench(match, paths, use_name=True):
+    """returns the mean per-entry matching cost in nanoseconds"""
+    start = time.perf_counter()
+    if use_name:
+        for path, name in paths:
+            match(path, name)
+    else:
+        for path, _ in paths:
+            match(path)
+    return (time.perf_counter() - start) / len(paths) * 1e9
+
+
+def bench_matchers(args):
+    clean = load_clean()
+    paths = sample_paths(args.entries)
+    counts = [int(c) for c in args.counts.split(',')]
+    print('%8s %14s %14s %14s %14s' % (
+        'patterns', 'endswith/any', 'SuffixMatcher', 'glob/fnmatch',
+        'GlobMatcher'))
+    for n in counts:
+        suffixes = ['.ext%d' % i for i in range(n - 1)] + ['.pyc']
+        # mix basename-safe and path globs, as used on the command line
+        globs = ['*.ext%d' % i for i in range(n // 2)]
+        globs += ['*/dir%d/*' % i for i in range(n - len(globs) - 1)]
+        globs += ['*/._*']
+        row = [
+            bench(lambda s: any(s.endswith(p) for p in suffixes), paths,
+                  use_name=False),
+            bench(clean.SuffixMatcher(suffixes), paths),
+            bench(lambda s: any(fnmatch(s, p) for p in globs), paths,
+                  use_name=False),
+            bench(clean.GlobMatcher(globs), paths),
+        ]
+        print('%8d' % n + ''.join(' %11.0f ns' % t for t in row))
+
+
+# -----------------------------------------------------
+# synthetic trees
+
+def make_file(path, size, crlf=False):
+    line = b'x' * 14 + (b'\r\n' if crlf else b'\n')
+    with open(path, 'wb') as f:
+        f.write(line * (size // len(line)) + b'y' * (size % len(line)))
+
+
+def make_wide(root, scale, rng):
+    """one level of many directories with a few files each"""
+    for i in range(int(2000 * scale)):
+        d = os.path.join(root, 'w%05d' % i)
+        os.mkdir(d)
+        for j in range(3):
+            make_file(os.path.join(d, 'f%d.txt' % j), 64)
+
+
+def make_deep(root, scale, rng):
+    """a few long chains of nested directories"""
+    for chain in range(4):
+        d = os.path.join(root, 'c%d' % chain)
+        for depth in range(int(200 * scale)):
+            d = os.path.join(d, 'l%03d' % depth)
+            os.makedirs(d)
+            make_file(os.path.join(d, 'f.txt'), 64)
+
+
+def make_tiny(root, scale, rng):
+    """many tiny (CRLF) files in a moderate directory tree"""
+    for i in range(int(20000 * scale)):
+        d = os.path.join(root, 't%02d' % (i % 50), 's%02d' % (i % 7))
+        os.makedirs(d, exist_ok=True)
+        ext = rng.choice(['.txt', '.py', '.log', '.csv'])
+        make_file(os.path.join(d, 'f%06d%s' % (i, ext)),
+                  rng.randrange(1, 256), crlf=True)
+
+
+def make_pycache(root, scale, rng):
+    """a python source tree with a __pycache__ in every package"""
+    for i in range(int(1000 * scale)):
+        d = os.path.join(root, 'p%02d' % (i % 20), 'm%04d' % i)
+        cache = os.path.join(d, '__pycache__')
+        os.makedirs(cache)
+        for j in range(5):
+            make_file(os.path.join(d, 'mod%d.py' % j), 256)
+            make_file(os.path.join(cache, 'mod%d.cpython-311.pyc' % j),
+                      512)
+
+
+SHAPES = {
+    'wide': make_wide,
+    'deep': make_deep,
+    'tiny': make_tiny,
+    'pycache': make_pycache,
+}
+
+
+def make_tree(shape, root, scale, seed=0):
+    """creates the synthetic tree of the given shape below root"""
+    os.makedirs(root)
+    SHAPES[shape](root, scale, random.Random('%s-%s' % (shape, seed)))
+
+
+# -----------------------------------------------------
+# tree benchmarks
+
+def timed(func, repeat):
+    """returns the min and median of repeat timings of func()"""
+    times = []
+    for _ in range(repeat):
+        start = time.perf_counter()
+        func()
+        times.append(time.perf_counter() - start)
+    return {'min': min(times), 'median': statistics.median(times)}
+
+
+def quiet(func, *args, **kwds):
+    with contextlib.redirect_stdout(io.StringIO()):
+        return func(*args, **kwds)
+
+
+def top_report(clean, root, patterns, **kwds):
+    """returns ({target: size}, [total lines]) of a --top walk"""
+    c = clean.Cleaner(root, patterns, top=10**9, native=False, **kwds)
+    out = io.StringIO()
+    with contextlib.redirect_stdout(out):
+        c.walk(root, c._show('endswith'))
+    ranked, _, totals = out.getvalue().partition('\nBy top-level')
+    sizes = dict(line.rsplit(None, 1)[::-1]
+                 for line in ranked.splitlines()[1:])
+    return sizes, totals.splitlines()[1:]
+
+
+def check_top(clean, root, patterns, jobs):
+    """raises if --top sizes differ with and without --prune: a matched
+    directory the scan descends into is only ranked once summed
+    """
+    pruned, pruned_totals = top_report(clean, root, patterns, prune=True)
+    for j in sorted({1, jobs}):
+        sizes, totals = top_report(clean, root, patterns, jobs=j)
+        wrong = [p for p, size in pruned.items() if sizes.get(p) != size]
+        if wrong or totals != pruned_totals:
+            raise RuntimeError('--top differs without --prune (jobs=%d) '
+                               'for %s' % (j, (wrong or totals)[:3]))
+
+
+def bench_tree(clean, root, args):
+    """returns {benchmark: timings} for one synthetic tree"""
+    results = {}
+    patterns = ['.pyc', '__pycache__', '.log']
+    check_top(clean, root, patterns, args.jobs)
+
+    # the pure Python scanner, and the native one if built
+    variants = [('', False)]
+    if clean._cleanscan is not None:
+        variants.append(('/native', True))
+
+    def walk(**kwds):
+        c = clean.Cleaner(root, patterns, **kwds)
+        return c.walk(root, c._show('endswith'), log=False)
+
+    for suffix, native in variants:
+        for jobs in sorted({1, args.jobs}):
+            for prune in (False, True):
+                name = 'walk/jobs=%d%s%s' % (
+                    jobs, '/prune' if prune else '', suffix)
+                results[name] = timed(
+                    lambda: walk(jobs=jobs, prune=prune, native=native),
+                    args.repeat)
+        results['walk/jobs=1/no-size' + suffix] = timed(
+            lambda: walk(sizes=False, native=native), args.repeat)
+
+    # matchers alone, over the names the walk sees
+    entries = []
+    for dirpath, dirs, files in os.walk(root):
+        entries.extend((os.path.join(dirpath, n), n) for n in dirs + files)
+    c = clean.Cleaner(root, patterns + ['*/._*'])
+    for kind in ('endswith', 'glob'):
+        match = c.matchers[kind]
+        results['match/%s' % kind] = timed(
+            lambda: [match(p, n) for p, n in entries], args.repeat)
+
+    # actions: dry-run (scan and collect targets) and real, each real run
+    # on a fresh copy of the tree
+    for action, pats in (('endswith_delete', patterns),
+                         ('convert', ['.txt', '.csv'])):
+        func_name = 'delete' if action == 'endswith_delete' else 'convert'
+        for suffix, native in variants:
+            c = clean.Cleaner(root, pats, jobs=args.jobs, prune=True,
+                              native=native)
+            matcher = c.actions[action][1]
+            results['%s/dry-run%s' % (func_name, suffix)] = timed(
+                lambda: c.walk(root, c._show(matcher), log=False),
+                args.repeat)
+
+        times = []
+        for _ in range(args.repeat):
+            copy = root + '.copy'
+            shutil.copytree(root, copy, symlinks=True)
+            c = clean.Cleaner(copy, pats, jobs=args.jobs, prune=True,
+                              native=False)
+            func, matcher = c.actions[action]
+            start = time.perf_counter()
+            c.targets = c.walk(copy, c._show(matcher), log=False)
+            quiet(c._apply, func)
+            times.append(time.perf_counter() - start)
+            shutil.rmtree(copy)
+        results['%s/real' % func_name] = {
+            'min': min(times), 'median': statistics.median(times)}
+    return results
+
+
+def git_revision():
+    try:
+        return subprocess.check_output(
+            ['git', 'rev-parse', '--short', 'HEAD'], cwd=HERE,
+            stderr=subprocess.DEVNULL, encoding='utf8').strip()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+
+def bench_run(args):
+    clean = load_clean()
+    shapes = args.shapes.split(',')
+    data = {
+        'meta': {
+            'revision': git_revision(),
+            'python': platform.python_version(),
+            'platform': platform.platform(),
+            'scale': args.scale,
+            'jobs': args.jobs,
+            'repeat': args.repeat,
+            'seed': args.seed,
+        },
+        'results': {},
+    }
+    base = tempfile.mkdtemp(prefix='bench_clean.', dir=args.tmpdir)
+    try:
+        for shape in shapes:
+            root = os.path.join(base, shape)
+            make_tree(shape, root, args.scale, args.seed)
+            for name, t in bench_tree(clean, root, args).items():
+                key = '%s/%s' % (shape, name)
+                data['results'][key] = t
+                print('%-40s %9.4fs' % (key, t['min']), file=sys.stderr)
+            shutil.rmtree(root)
+    finally:
+        shutil.rmtree(base, ignore_errors=True)
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(data, f, indent=2, sort_keys=True)
+    else:
+        json.dump(data, sys.stdout, indent=2, sort_keys=True)
+        print()
+
+
+def bench_compare(args):
+    with open(args.before) as f:
+        before = json.load(f)
+    with open(args.after) as f:
+        after = json.load(f)
+    print('before: %s  after: %s' % (
+        before['meta'].get('revision'), after['meta'].get('revision')))
+    print('%-40s %10s %10s %8s' % ('benchmark', 'before', 'after', 'change'))
+    regressions = 0
+    for key in sorted(set(before['results']) | set(after['results'])):
+        a = before['results'].get(key, {}).get(args.stat)
+        b = after['results'].get(key, {}).get(args.stat)
+        if a is None or b is None:
+            print('%-40s %10s %10s' % (
+                key, '-' if a is None else '%.4fs' % a,
+                '-' if b is None else '%.4fs' % b))
+            continue
+        change = (b - a) / a * 100 if a else 0.0
+        flag = ''
+        if change > args.threshold:
+            flag = '  slower'
+            regressions += 1
+        elif change < -args.threshold:
+            flag = '  faster'
+        print('%-40s %9.4fs %9.4fs %+7.1f%%%s' % (key, a, b, change, flag))
+    return 1 if regressions and args.fail else 0
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='benchmarks for the clean script')
+    sub = parser.add_subparsers(dest='command', required=True)
+
+    p = sub.add_parser('matchers', help='per-entry pattern matching cost')
+    p.add_argument('--counts', default='1,10,100,200,500',
+                   help='comma separated pattern counts')
+    p.add_argument('--entries', type=int, default=20000,
+                   help='number of sample paths')
+    p.set_defaults(func=bench_matchers)
+
+    p = sub.add_parser('run', help='synthetic tree benchmarks (JSON)')
+    p.add_argument('--shapes', default=','.join(SHAPES),
+                   help='comma separated tree shapes (%(default)s)')
+    p.add_argument('--scale', type=float, default=1.0,
+                   help='tree size multiplier')
+    p.add_argument('--jobs', type=int, default=8,
+                   help='threads for the parallel runs')
+    p.add_argument('--repeat', type=int, default=3,
+                   help='timings per benchmark')
+    p.add_argument('--seed', type=int, default=0,
+                   help='seed for the tree generator')
+    p.add_argument('--tmpdir', help='where to generate the trees')
+    p.add_argument('-o', '--output', help='JSON file (default: stdout)')
+    p.set_defaults(func=bench_run)
+
+    p = sub.add_parser('compare', help='diff two run results')
+    p.add_argument('before')
+    p.add_argument('after')
+    p.add_argument('--stat', default='min', choices=['min', 'median'])
+    p.add_argument('--threshold', type=float, default=10.0,
+                   help='percent change to flag (%(default)s)')
+    p.add_argument('--fail', action='store_true',
+                   help='exit with 1 if anything got slower')
+    p.set_defaults(func=bench_compare)
+
+    args = parser.parse_args()
+    sys.exit(args.func(args))
+
+
+if __name__ == '__main__':
+    main()